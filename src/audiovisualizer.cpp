@@ -1,6 +1,8 @@
 #include <array>
 #include <algorithm>
 #include <filesystem>
+#include <optional>
+#include <span>
 #include <string>
 #include <valarray>
 #include <vector>
@@ -13,6 +15,8 @@
 #include <kiss_fft.h>
 
 #include "audiovisualizer.h"
+#include "beatdetector.h"
+#include "samplestore.h"
 
 struct PlaylistItem {
   std::filesystem::path path;
@@ -25,10 +29,15 @@ const int kWIndowHeight = 600;
 const char* kWindowTitle = "Raylib Audio Visualizer";
 const int kSamplesPerUpdate = 4096;
 const int kFFTSize = 4096;
+const int kMinWindowWidth = 400;
+const int kMinWindowHeight = 300;
+const double kResizeDebounceSeconds = 0.15;
 const int kBarWidth = 20;
+const int kFramesPerPeak = 256;
+const int kOnsetMinIntervalHops = 1;
 
-std::string format_wave_timestamp(Wave &wave, int frame_index) {
-  int total_seconds = frame_index / wave.sampleRate;
+std::string format_wave_timestamp(int sample_rate, int frame_index) {
+  int total_seconds = frame_index / sample_rate;
   int seconds = total_seconds % 60;
   int minutes = total_seconds / 60;
 
@@ -36,7 +45,9 @@ std::string format_wave_timestamp(Wave &wave, int frame_index) {
 }
 
 void AudioVisualizer::run() {
+  SetConfigFlags(FLAG_WINDOW_RESIZABLE | FLAG_WINDOW_HIGHDPI);
   InitWindow(kWindowWidth, kWIndowHeight, kWindowTitle);
+  SetWindowMinSize(kMinWindowWidth, kMinWindowHeight);
   InitAudioDevice();
   SetExitKey(KEY_ESCAPE);
   SetTargetFPS(60);
@@ -57,24 +68,32 @@ void AudioVisualizer::run() {
 
   std::vector<PlaylistItem> playlist;
 
-  Wave wave;
+  SampleStore store;
+  std::optional<SamplePrecision> sample_precision;
   AudioStream stream = LoadAudioStream(48000, 16, 1);
-  float* samples = nullptr;
+  std::vector<float> stream_buffer;
+  std::vector<float> fft_samples(kFFTSize);
+  std::vector<float> scope_samples;
   int wave_index = 0;
   std::string total_timestamp = "--:--";
 
-  const int num_bars = kWindowWidth / kBarWidth;
-  const int freqs_per_bar = kFFTSize / num_bars / 2;
+  BeatAnalyzer beat_analyzer;
+  BeatMap beat_map;
+  OnsetDetector onset_detector(kFFTSize / 2, kOnsetMinIntervalHops);
+  std::vector<float> magnitudes(kFFTSize / 2);
+  float beat_pulse = 0;
+  bool snap_to_beats = true;
 
-  std::valarray<float> frequencies(num_bars);
-  std::valarray<float> max_frequencies(num_bars);
-  std::valarray<float> fall_velocity(num_bars);
+  int layout_width = 0;
+  bool layout_pending = false;
+  double resize_time = 0;
 
-  for (int i = 0; i < frequencies.size(); i++) {
-    frequencies[i] = 0;
-    max_frequencies[i] = 0;
-    fall_velocity[i] = 0;
-  }
+  int num_bars = 0;
+  std::vector<int> bar_bins;
+
+  std::valarray<float> frequencies;
+  std::valarray<float> max_frequencies;
+  std::valarray<float> fall_velocity;
 
   for (int i = 0; i < hanning.size(); i++) {
     hanning[i] = 0.5 * (1 - std::cos((2 * M_PI * i) / (hanning.size() - 1)));
@@ -84,98 +103,166 @@ void AudioVisualizer::run() {
   float panel_height = 64;
   float wavepanel_height = 128;
 
-  RenderTexture2D waveform_texture = LoadRenderTexture(kWindowWidth, wavepanel_height);
-  BeginTextureMode(waveform_texture);
-  ClearBackground(BLACK);
-
-  int half_wavepanel_height = wavepanel_height / 2;
-  DrawLine(0, half_wavepanel_height, kWindowWidth, half_wavepanel_height, DARKGRAY);
-  DrawLine(0, half_wavepanel_height - 8, kWindowWidth, half_wavepanel_height - 8, DARKGRAY);
-  DrawLine(0, half_wavepanel_height - 24, kWindowWidth, half_wavepanel_height - 24, DARKGRAY);
-  DrawLine(0, half_wavepanel_height - 48, kWindowWidth, half_wavepanel_height - 48, DARKGRAY);
-  DrawLine(0, half_wavepanel_height + 8, kWindowWidth, half_wavepanel_height + 8, DARKGRAY);
-  DrawLine(0, half_wavepanel_height + 24, kWindowWidth, half_wavepanel_height + 24, DARKGRAY);
-  DrawLine(0, half_wavepanel_height + 48, kWindowWidth, half_wavepanel_height + 48, DARKGRAY);
-
-  for (int i = 0; i < kWindowWidth; i += 40) {
-    DrawLine(i, 0, i, wavepanel_height, DARKGRAY);
-  }
-  EndTextureMode();
+  PeakCache peak_cache;
+  RenderTexture2D waveform_texture {};
+
+  // The waveform texture is allocated at the framebuffer resolution so it
+  // stays sharp on HiDPI displays; everything here is in texture pixels.
+  auto draw_waveform_texture = [&]() {
+    int texture_width = waveform_texture.texture.width;
+    int texture_height = waveform_texture.texture.height;
+    float scale_x = (float)texture_width / layout_width;
+    float scale_y = (float)texture_height / wavepanel_height;
+
+    BeginTextureMode(waveform_texture);
+    ClearBackground(BLACK);
+
+    int half_wavepanel_height = texture_height / 2;
+    for (int offset : { 0, 8, 24, 48 }) {
+      int dy = offset * scale_y;
+      DrawLine(0, half_wavepanel_height - dy, texture_width, half_wavepanel_height - dy, DARKGRAY);
+      DrawLine(0, half_wavepanel_height + dy, texture_width, half_wavepanel_height + dy, DARKGRAY);
+    }
+
+    for (float x = 0; x < texture_width; x += 40 * scale_x) {
+      DrawLine(x, 0, x, texture_height, DARKGRAY);
+    }
+
+    if (!peak_cache.empty()) {
+      int base_y = half_wavepanel_height;
+      float peak_scale = half_wavepanel_height * 0.75;
+      float frames_per_pixel = (float)store.frame_count() / texture_width;
+
+      for (int x = 0; x < texture_width; x++) {
+        int frame_index1 = (int)(frames_per_pixel * x);
+        int frame_index2 = (int)(frames_per_pixel * (x + 1));
+
+        const auto [min, max] = peak_cache.peaks(frame_index1, frame_index2);
+        float min_sample = min * peak_scale;
+        float max_sample = max * peak_scale;
+        DrawRectangle(x, base_y - max_sample, 1, max_sample - min_sample, WHITE);
+      }
+    }
+    EndTextureMode();
+  };
+
+  // Only reallocates what depends on the changed dimension: the bar to FFT
+  // bin table, the scope buffer and the waveform texture.
+  auto update_layout = [&](int width) {
+    layout_width = std::max(1, width);
+
+    int new_num_bars = std::clamp(layout_width / kBarWidth, 1, kFFTSize / 2);
+    if (new_num_bars != num_bars) {
+      num_bars = new_num_bars;
+      bar_bins.resize(num_bars + 1);
+      for (int i = 0; i <= num_bars; i++) {
+        bar_bins[i] = i * (kFFTSize / 2) / num_bars;
+      }
+      frequencies.resize(num_bars);
+      max_frequencies.resize(num_bars);
+      fall_velocity.resize(num_bars);
+    }
+
+    if (scope_samples.size() != layout_width / 2 + 1) {
+      scope_samples.resize(layout_width / 2 + 1);
+    }
+
+    Vector2 dpi = GetWindowScaleDPI();
+    int texture_width = layout_width * dpi.x;
+    int texture_height = wavepanel_height * dpi.y;
+    if (texture_width != waveform_texture.texture.width || texture_height != waveform_texture.texture.height) {
+      spdlog::debug("Resizing waveform texture to {}x{}", texture_width, texture_height);
+      if (waveform_texture.id) {
+        UnloadRenderTexture(waveform_texture);
+      }
+      waveform_texture = LoadRenderTexture(texture_width, texture_height);
+      draw_waveform_texture();
+    }
+  };
+
+  update_layout(GetScreenWidth());
 
   auto unload_wave = [&]() {
-    if (!samples) {
+    if (store.empty()) {
       return;
     }
 
     spdlog::info("Unloading previous file.");
     StopAudioStream(stream);
-    UnloadWaveSamples(samples);
-    samples = nullptr;
     UnloadAudioStream(stream);
-    UnloadWave(wave);
+    beat_analyzer.cancel();
+    beat_map = {};
+    onset_detector.reset();
+    peak_cache.clear();
+    store.clear();
     wave_index = 0;
     total_timestamp = "--:--";
   };
 
   auto load_wave = [&](const std::filesystem::path wav_path) {
-    int width = GetScreenWidth();
-    int height = GetScreenHeight();
-
     spdlog::info("Audio file loaded: {}", wav_path.string());
-    wave = LoadWave(wav_path.c_str());
+    Wave wave = LoadWave(wav_path.c_str());
+    spdlog::info("wave sampleRate:{}, sampleSize:{}, channels:{}", wave.sampleRate, wave.sampleSize, wave.channels);
+
+    SamplePrecision precision = sample_precision.value_or(precision_for_sample_size(wave.sampleSize));
 
     if (wave.sampleSize != 32) {
       WaveFormat(&wave, wave.sampleRate, 32, wave.channels);
     }
 
-    samples = LoadWaveSamples(wave);
-
-    spdlog::info("Generating waveform texture");
-    BeginTextureMode(waveform_texture);
-    {
-      ClearBackground(BLACK);
-
-      int half_wavepanel_height = wavepanel_height / 2;
-      DrawLine(0, half_wavepanel_height, kWindowWidth, half_wavepanel_height, DARKGRAY);
-      DrawLine(0, half_wavepanel_height - 8, kWindowWidth, half_wavepanel_height - 8, DARKGRAY);
-      DrawLine(0, half_wavepanel_height - 24, kWindowWidth, half_wavepanel_height - 24, DARKGRAY);
-      DrawLine(0, half_wavepanel_height - 48, kWindowWidth, half_wavepanel_height - 48, DARKGRAY);
-      DrawLine(0, half_wavepanel_height + 8, kWindowWidth, half_wavepanel_height + 8, DARKGRAY);
-      DrawLine(0, half_wavepanel_height + 24, kWindowWidth, half_wavepanel_height + 24, DARKGRAY);
-      DrawLine(0, half_wavepanel_height + 48, kWindowWidth, half_wavepanel_height + 48, DARKGRAY);
+    // Only the planar store outlives this function. The wave is released as
+    // soon as its interleaved float copy exists, so at most one float copy is
+    // alive while the store fills.
+    int frame_count = wave.frameCount;
+    int channels = wave.channels;
+    int sample_rate = wave.sampleRate;
+    float* samples = LoadWaveSamples(wave);
+    UnloadWave(wave);
 
-      for (int i = 0; i < kWindowWidth; i += 40) {
-        DrawLine(i, 0, i, wavepanel_height, DARKGRAY);
-      }
+    beat_analyzer.cancel();
+    store.load(samples, frame_count, channels, sample_rate, precision);
+    UnloadWaveSamples(samples);
 
-      int base_y = (wavepanel_height / 2);
-      int frame_count = wave.frameCount;
-      float scale_y = (wavepanel_height / 2) * 0.75;
-      float frames_per_pixel = (float)frame_count / width;
+    spdlog::info("Sample store: {}, {} KiB", precision_name(store.precision()), store.size_bytes() / 1024);
 
-      int dx = 1;
-      for (int x = 0; x < width; x += dx) {
-        int sample_index1 = (int)(frames_per_pixel * x) * wave.channels;
-        int sample_index2 = (int)(frames_per_pixel * (x + dx)) * wave.channels;
+    spdlog::info("Starting beat analysis");
+    beat_map = {};
+    onset_detector.reset();
+    beat_analyzer.start(store);
 
-        const auto [min, max] = std::minmax_element(&samples[sample_index1], &samples[sample_index2]);
-        float min_sample = std::min(0.0f, *min) * scale_y;
-        float max_sample = std::max(0.0f, *max) * scale_y;
-        DrawRectangle(x, base_y - max_sample, dx, max_sample - min_sample, WHITE);
-      }
-    }
-    EndTextureMode();
+    spdlog::info("Generating waveform texture");
+    peak_cache.build(store, kFramesPerPeak);
+    draw_waveform_texture();
 
-    spdlog::info("wave sampleRate:{}, sampleSize:{}, channels:{}", wave.sampleRate, wave.sampleSize, wave.channels);
-    stream = LoadAudioStream(wave.sampleRate, wave.sampleSize, wave.channels);
+    stream = LoadAudioStream(store.sample_rate(), 32, store.channels());
+    stream_buffer.resize(kSamplesPerUpdate * store.channels());
     wave_index = 0;
-    total_timestamp = format_wave_timestamp(wave, wave.frameCount);
+    total_timestamp = format_wave_timestamp(store.sample_rate(), store.frame_count());
 
     if (auto_play) {
       PlayAudioStream(stream);
     }
   };
 
+  auto seek = [&](int frame_index) {
+    frame_index = std::clamp(frame_index, 0, store.frame_count());
+    if (snap_to_beats) {
+      frame_index = snap_to_beat(beat_map, frame_index);
+    }
+    wave_index = frame_index;
+  };
+
+  // Relative skips snap in the direction of travel so that a forward skip
+  // near the end never lands on an earlier beat, and vice versa.
+  auto skip = [&](int frames) {
+    int frame_index = std::clamp(wave_index + frames, 0, store.frame_count());
+    if (snap_to_beats && !beat_map.beats.empty()) {
+      std::optional<int> beat = frames >= 0 ? beat_at_or_after(beat_map, frame_index) : beat_at_or_before(beat_map, frame_index);
+      frame_index = beat.value_or(wave_index);
+    }
+    wave_index = frame_index;
+  };
+
   auto push_disabled_btn_flags = []() {
     ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true);
     ImGui::PushStyleColor(ImGuiCol_Button, ImVec4(0.5f, 0.5f, 0.5f, 0.5f));
@@ -194,19 +281,37 @@ void AudioVisualizer::run() {
     int height = GetScreenHeight();
     float spectrum_height = height - panel_height - wavepanel_height; // - menu_height;
 
+    // Resizes are applied once the window has settled so that dragging the
+    // edge doesn't reallocate the texture every frame.
+    if (IsWindowResized()) {
+      layout_pending = true;
+      resize_time = GetTime();
+    }
+
+    if (layout_pending && GetTime() - resize_time >= kResizeDebounceSeconds) {
+      layout_pending = false;
+      update_layout(width);
+    }
+
+    if (auto result = beat_analyzer.take_result()) {
+      beat_map = std::move(*result);
+    }
+
+    beat_pulse = std::max(0.0f, beat_pulse - GetFrameTime() * 4);
+
     BeginDrawing();
     ClearBackground({ 57, 58, 75, 255 });
 
-    if (samples) {
-      for (int i = 0; i < kWindowWidth / 2; i+= 1) {
-        int idx = wave_index + i;
-        if (idx + 1 >= wave.frameCount) {
-          break;
-        }
+    if (beat_pulse > 0) {
+      DrawRectangle(0, 0, width, spectrum_height, Fade(WHITE, beat_pulse * 0.08f));
+    }
 
+    if (!store.empty()) {
+      int scope_count = store.read_channel(0, wave_index, scope_samples);
+      for (int i = 0; i + 1 < scope_count; i+= 1) {
         const float scale = (spectrum_height / 2) * 0.86;
-        float s1 = samples[idx * wave.channels];
-        float s2 = samples[(idx + 1) * wave.channels];
+        float s1 = scope_samples[i];
+        float s2 = scope_samples[i + 1];
         int mid_y = spectrum_height / 2;
 
 
@@ -218,8 +323,8 @@ void AudioVisualizer::run() {
 
     for (int i = 0; i < frequencies.size(); i++) {
       float f = frequencies[i];
-      int w = kBarWidth;
-      int x = i * w;
+      int x = i * width / num_bars;
+      int w = (i + 1) * width / num_bars - x;
       int h = f * spectrum_height;
       int y = spectrum_height - h;
 
@@ -245,16 +350,25 @@ void AudioVisualizer::run() {
       max_frequencies[i] = f;
 
       int h = 3;
+      int x = i * width / num_bars;
+      int w = (i + 1) * width / num_bars - x;
       int y = spectrum_height - (f * spectrum_height);
-      DrawRectangle(i * kBarWidth, y, kBarWidth, h, GOLD);
+      DrawRectangle(x, y, w, h, GOLD);
     }
 
     Vector2 wavepanel_min { 0, height - panel_height - wavepanel_height };
     Vector2 wavepanel_max { (float)width, height - panel_height };
 
-    DrawTexture(waveform_texture.texture, 0, wavepanel_min.y, WHITE);
-    if (samples) {
-      int frame_count = wave.frameCount;
+    Texture2D &waveform = waveform_texture.texture;
+    DrawTexturePro(waveform, { 0, 0, (float)waveform.width, (float)waveform.height }, { 0, wavepanel_min.y, (float)width, wavepanel_height }, { 0, 0 }, 0, WHITE);
+    if (!store.empty()) {
+      int frame_count = store.frame_count();
+
+      for (int beat : beat_map.beats) {
+        int beat_x = width * ((float)beat / frame_count);
+        DrawLine(beat_x, wavepanel_min.y, beat_x, wavepanel_max.y, Fade(GOLD, 0.35f));
+      }
+
       float pct = (float)wave_index / frame_count;
       int bar_x = width * pct;
 
@@ -272,7 +386,7 @@ void AudioVisualizer::run() {
       if (mouse.y >= wavepanel_min.y && mouse.y < wavepanel_max.y) {
         if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON) || (IsMouseButtonDown(MOUSE_LEFT_BUTTON) && (mouse_delta.x || mouse_delta.y))) {
           float pct = std::clamp((float)mouse.x / width, 0.f, 1.f);
-          wave_index = pct * frame_count;
+          seek(pct * frame_count);
         }
       }
     }
@@ -301,34 +415,22 @@ void AudioVisualizer::run() {
               spdlog::error("Loading failed: {}", NFD_GetError());
             }
           }
-          if (ImGui::MenuItem("Unload Audio File", nullptr, false, samples != nullptr)) {
+          if (ImGui::MenuItem("Unload Audio File", nullptr, false, !store.empty())) {
             spdlog::info("Unloading wave file");
             StopAudioStream(stream);
-            UnloadWave(wave);
             UnloadAudioStream(stream);
-            UnloadWaveSamples(samples);
-            samples = nullptr;
+            beat_analyzer.cancel();
+            beat_map = {};
+            onset_detector.reset();
+            peak_cache.clear();
+            store.clear();
             wave_index = 0;
 
             for (int i = 0; i < frequencies.size(); i++) {
               frequencies[i] = 0;
             }
 
-            BeginTextureMode(waveform_texture);
-            ClearBackground(BLACK);
-            int half_wavepanel_height = wavepanel_height / 2;
-            DrawLine(0, half_wavepanel_height, kWindowWidth, half_wavepanel_height, DARKGRAY);
-            DrawLine(0, half_wavepanel_height - 8, kWindowWidth, half_wavepanel_height - 8, DARKGRAY);
-            DrawLine(0, half_wavepanel_height - 24, kWindowWidth, half_wavepanel_height - 24, DARKGRAY);
-            DrawLine(0, half_wavepanel_height - 48, kWindowWidth, half_wavepanel_height - 48, DARKGRAY);
-            DrawLine(0, half_wavepanel_height + 8, kWindowWidth, half_wavepanel_height + 8, DARKGRAY);
-            DrawLine(0, half_wavepanel_height + 24, kWindowWidth, half_wavepanel_height + 24, DARKGRAY);
-            DrawLine(0, half_wavepanel_height + 48, kWindowWidth, half_wavepanel_height + 48, DARKGRAY);
-
-            for (int i = 0; i < kWindowWidth; i += 40) {
-              DrawLine(i, 0, i, wavepanel_height, DARKGRAY);
-            }
-            EndTextureMode();
+            draw_waveform_texture();
           }
           ImGui::Separator();
           if (ImGui::MenuItem("Quit")) {
@@ -341,29 +443,42 @@ void AudioVisualizer::run() {
           ImGui::MenuItem("Show Playlist", nullptr, &show_playlist);
           ImGui::MenuItem("Audo-Play", nullptr, &auto_play);
           ImGui::Separator();
+          if (ImGui::BeginMenu("Sample Precision")) {
+            if (ImGui::MenuItem("Auto", nullptr, !sample_precision.has_value())) {
+              sample_precision.reset();
+            }
+            for (SamplePrecision precision : { SamplePrecision::Float32, SamplePrecision::Int24, SamplePrecision::Int16 }) {
+              if (ImGui::MenuItem(precision_name(precision), nullptr, sample_precision == precision)) {
+                sample_precision = precision;
+              }
+            }
+            ImGui::EndMenu();
+          }
+          ImGui::Separator();
           ImGui::MenuItem("Loop", nullptr, &should_loop);
-          if (ImGui::MenuItem("Play", nullptr, false, samples != nullptr && !IsAudioStreamPlaying(stream))) {
+          ImGui::MenuItem("Snap Seek to Beats", nullptr, &snap_to_beats);
+          if (ImGui::MenuItem("Play", nullptr, false, !store.empty() && !IsAudioStreamPlaying(stream))) {
             PlayAudioStream(stream);
           }
-          if (ImGui::MenuItem("Pause",  nullptr, false, samples != nullptr && IsAudioStreamPlaying(stream))) {
+          if (ImGui::MenuItem("Pause",  nullptr, false, !store.empty() && IsAudioStreamPlaying(stream))) {
             StopAudioStream(stream);
           }
-          if (ImGui::MenuItem("Stop",  nullptr, false, samples != nullptr && IsAudioStreamPlaying(stream))) {
+          if (ImGui::MenuItem("Stop",  nullptr, false, !store.empty() && IsAudioStreamPlaying(stream))) {
             StopAudioStream(stream);
             wave_index = 0;
           }
           ImGui::Separator();
-          if (ImGui::MenuItem("-30s", nullptr, false, samples != nullptr)) {
-            wave_index = std::clamp(wave_index - ((int)wave.sampleRate * 30), 0, (int)wave.frameCount);
+          if (ImGui::MenuItem("-30s", nullptr, false, !store.empty())) {
+            skip(-store.sample_rate() * 30);
           }
-          if (ImGui::MenuItem("-10s", nullptr, false, samples != nullptr)) {
-            wave_index = std::clamp(wave_index - ((int)wave.sampleRate * 10), 0, (int)wave.frameCount);
+          if (ImGui::MenuItem("-10s", nullptr, false, !store.empty())) {
+            skip(-store.sample_rate() * 10);
           }
-          if (ImGui::MenuItem("+10s", nullptr, false, samples != nullptr)) {
-            wave_index = std::clamp(wave_index + ((int)wave.sampleRate * 10), 0, (int)wave.frameCount);
+          if (ImGui::MenuItem("+10s", nullptr, false, !store.empty())) {
+            skip(store.sample_rate() * 10);
           }
-          if (ImGui::MenuItem("+30s", nullptr, false, samples != nullptr)) {
-            wave_index = std::clamp(wave_index + ((int)wave.sampleRate * 30), 0, (int)wave.frameCount);
+          if (ImGui::MenuItem("+30s", nullptr, false, !store.empty())) {
+            skip(store.sample_rate() * 30);
           }
 
           ImGui::EndMenu();
@@ -392,18 +507,18 @@ void AudioVisualizer::run() {
       ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, frame_padding);
       ImGui::PushStyleVar(ImGuiStyleVar_FrameRounding, 4.0f);
 
-      if (!samples) {
+      if (store.empty()) {
         push_disabled_btn_flags();
       }
 
       if (ImGui::Button(ICON_FA_BACKWARD_FAST)) {
         spdlog::debug("Fast backward button pressed");
-        wave_index = std::clamp(wave_index - ((int)wave.sampleRate * 30), 0, (int)wave.frameCount);
+        skip(-store.sample_rate() * 30);
       }
       ImGui::SameLine();
       if (ImGui::Button(ICON_FA_BACKWARD_STEP)) {
         spdlog::debug("Step backward button pressed");
-        wave_index = std::clamp(wave_index - ((int)wave.sampleRate * 10), 0, (int)wave.frameCount);
+        skip(-store.sample_rate() * 10);
       }
 
       ImGui::SameLine();
@@ -444,15 +559,15 @@ void AudioVisualizer::run() {
       ImGui::SameLine();
       if (ImGui::Button(ICON_FA_FORWARD_STEP)) {
         spdlog::debug("Fast forward button pressed");
-        wave_index = std::clamp(wave_index + ((int)wave.sampleRate * 10), 0, (int)wave.frameCount);
+        skip(store.sample_rate() * 10);
       }
       ImGui::SameLine();
       if (ImGui::Button(ICON_FA_FORWARD_FAST)) {
         spdlog::debug("Step forward button pressed");
-        wave_index = std::clamp(wave_index + ((int)wave.sampleRate * 30), 0, (int)wave.frameCount);
+        skip(store.sample_rate() * 30);
       }
 
-      if (!samples) {
+      if (store.empty()) {
         pop_disabled_btn_flags();
       }
 
@@ -462,13 +577,20 @@ void AudioVisualizer::run() {
       ImGui::SameLine();
 
       std::string current_timestamp;
-      if (samples) {
-        current_timestamp = format_wave_timestamp(wave, wave_index);
+      if (!store.empty()) {
+        current_timestamp = format_wave_timestamp(store.sample_rate(), wave_index);
       } else {
         current_timestamp = "--:--";
       }
 
-      ImGui::Text(fmt::format("{} / {}", current_timestamp, total_timestamp).c_str());
+      std::string tempo;
+      if (beat_map.bpm > 0) {
+        tempo = fmt::format("{:.0f} BPM", beat_map.bpm);
+      } else if (beat_analyzer.busy()) {
+        tempo = "Analyzing beats...";
+      }
+
+      ImGui::Text(fmt::format("{} / {}  {}", current_timestamp, total_timestamp, tempo).c_str());
 
       if (show_about) {
         if (ImGui::Begin("About Audio Visualizer", &show_about)) {
@@ -559,28 +681,36 @@ void AudioVisualizer::run() {
 
     EndDrawing();
 
-    if (samples) {
+    if (!store.empty()) {
       int samples_left = kSamplesPerUpdate;
       int freq_wave_index = wave_index;
+      bool refilled = false;
       if (IsAudioStreamPlaying(stream) && IsAudioStreamProcessed(stream)) {
+        refilled = true;
         while (samples_left) {
-          int samples_to_write = std::min((int)wave.frameCount, wave_index + samples_left) - wave_index;
-          UpdateAudioStream(stream, &samples[wave_index * wave.channels], samples_to_write);
+          int offset = (kSamplesPerUpdate - samples_left) * store.channels();
+          int samples_to_write = store.read_interleaved(wave_index, std::span(stream_buffer).subspan(offset));
           wave_index += samples_to_write;
           samples_left -= samples_to_write;
-          if (wave_index >= wave.frameCount) {
+          if (wave_index >= store.frame_count()) {
             wave_index = 0;
             if (!should_loop) {
               StopAudioStream(stream);
             }
           }
         }
+        UpdateAudioStream(stream, stream_buffer.data(), kSamplesPerUpdate);
+      }
+
+      int fft_filled = 0;
+      while (fft_filled < kFFTSize) {
+        int frame_index = (freq_wave_index + fft_filled) % store.frame_count();
+        fft_filled += store.read_channel(0, frame_index, std::span(fft_samples).subspan(fft_filled));
       }
 
       for (int i = 0; i < kFFTSize; i++) {
-        fft_input[i].r = samples[freq_wave_index * wave.channels] * hanning[i];
+        fft_input[i].r = fft_samples[i] * hanning[i];
         fft_input[i].i = 0.0f;
-        freq_wave_index = (freq_wave_index + 1) % wave.frameCount;
       }
 
       kiss_fft(cfg, fft_input.data(), fft_output.data());
@@ -596,27 +726,37 @@ void AudioVisualizer::run() {
         max_magnitude = std::max(max_magnitude, out.r);
       }
 
+      for (int i = 0; i < magnitudes.size(); i++) {
+        magnitudes[i] = fft_output[i].r;
+      }
+
+      // The analysis window only advances by one hop of kSamplesPerUpdate
+      // frames per refill; feeding the repeated spectrum in between would
+      // drag the detector's running mean down to zero.
+      if (refilled && onset_detector.process(magnitudes)) {
+        beat_pulse = 1.0f;
+      }
+
       for (int i = 0; i < frequencies.size(); i++) {
-        for (int j = 0; j < freqs_per_bar; j++) {
+        for (int j = bar_bins[i]; j < bar_bins[i + 1]; j++) {
           const float scale_magnitude = 16.f;
-          float magnitude = fft_output[(i * freqs_per_bar) + j].r;
+          float magnitude = fft_output[j].r;
           float f = std::clamp(std::log(1 + magnitude * scale_magnitude) / std::log(1 + max_magnitude * scale_magnitude), 0.f, 1.f);
           frequencies[i] += f;
         }
       }
 
       for (int i = 0; i < frequencies.size(); i++) {
-        frequencies[i] /= (float)freqs_per_bar;
+        frequencies[i] /= (float)std::max(1, bar_bins[i + 1] - bar_bins[i]);
       }
     }
   }
 
-  if (samples) {
+  if (!store.empty()) {
     StopAudioStream(stream);
-    UnloadWave(wave);
     UnloadAudioStream(stream);
-    UnloadWaveSamples(samples);
-    samples = nullptr;
+    beat_analyzer.cancel();
+    store.clear();
   }
 
   kiss_fft_free(cfg);
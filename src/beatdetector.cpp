@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <utility>
+#include <spdlog/spdlog.h>
+#include <kiss_fft.h>
+
+#include "beatdetector.h"
+
+namespace {
+
+const int kAnalysisFFTSize = 2048;
+const int kAnalysisHopSize = 512;
+const float kMinBPM = 60.0f;
+const float kMaxBPM = 200.0f;
+const float kPreferredBPM = 120.0f;
+const float kMinTempoConfidence = 0.1f;
+const float kMinOnsetsPerSecond = 0.25f;
+const float kMinBeatPeakRatio = 1.5f;
+
+}
+
+OnsetDetector::OnsetDetector(int num_bins, int min_interval, float sensitivity)
+  : previous_(num_bins, 0.0f), min_interval_(min_interval), sensitivity_(sensitivity) {
+}
+
+bool OnsetDetector::process(std::span<const float> magnitudes) {
+  const int num_bins = std::min(magnitudes.size(), previous_.size());
+
+  float flux = 0.0f;
+  for (int i = 0; i < num_bins; i++) {
+    float magnitude = std::log1p(magnitudes[i]);
+    flux += std::max(0.0f, magnitude - previous_[i]);
+    previous_[i] = magnitude;
+  }
+  flux_ = flux / std::max(1, num_bins);
+
+  float mean = history_count_ ? history_sum_ / history_count_ : flux_;
+  bool is_onset = history_count_ == kHistorySize
+    && frames_since_onset_ >= min_interval_
+    && flux_ > mean * sensitivity_
+    && flux_ > 1e-4f;
+
+  history_sum_ += flux_ - history_[history_index_];
+  history_[history_index_] = flux_;
+  history_index_ = (history_index_ + 1) % kHistorySize;
+  history_count_ = std::min(history_count_ + 1, kHistorySize);
+
+  frames_since_onset_ = is_onset ? 0 : frames_since_onset_ + 1;
+  return is_onset;
+}
+
+void OnsetDetector::reset() {
+  std::fill(previous_.begin(), previous_.end(), 0.0f);
+  history_.fill(0.0f);
+  history_sum_ = 0.0f;
+  history_index_ = 0;
+  history_count_ = 0;
+  frames_since_onset_ = 0;
+  flux_ = 0.0f;
+}
+
+float OnsetDetector::flux() const {
+  return flux_;
+}
+
+float estimate_tempo(std::span<const float> envelope, float frames_per_second) {
+  const int min_lag = std::max(1, (int)std::floor(frames_per_second * 60.0f / kMaxBPM));
+  const int max_lag = (int)std::ceil(frames_per_second * 60.0f / kMinBPM);
+  const int n = envelope.size();
+  if (n < max_lag * 4) {
+    return 0.0f;
+  }
+
+  const float mean = std::accumulate(envelope.begin(), envelope.end(), 0.0f) / n;
+
+  float variance = 0.0f;
+  for (int i = 0; i < n; i++) {
+    variance += (envelope[i] - mean) * (envelope[i] - mean);
+  }
+  variance /= n;
+
+  if (variance <= 0.0f) {
+    return 0.0f;
+  }
+
+  std::vector<float> correlation(max_lag + 2, 0.0f);
+  for (int lag = min_lag - 1; lag <= max_lag + 1; lag++) {
+    float sum = 0.0f;
+    for (int i = lag; i < n; i++) {
+      sum += (envelope[i] - mean) * (envelope[i - lag] - mean);
+    }
+    correlation[lag] = sum / (n - lag);
+  }
+
+  // Weight lags by a log-normal window around kPreferredBPM so that half and
+  // double tempo candidates don't win on a near tie.
+  int best_lag = 0;
+  float best_score = 0.0f;
+  for (int lag = min_lag; lag <= max_lag; lag++) {
+    float octaves = std::log2((frames_per_second * 60.0f / lag) / kPreferredBPM);
+    float score = correlation[lag] * std::exp(-0.5f * octaves * octaves);
+    if (score > best_score) {
+      best_score = score;
+      best_lag = lag;
+    }
+  }
+
+  // Noise and tempo-less audio still have some lag that correlates best, so
+  // only trust the winner if it explains a fair share of the variance.
+  if (best_lag == 0 || correlation[best_lag] / variance < kMinTempoConfidence) {
+    spdlog::debug("No tempo found, best lag confidence {:.3f}", best_lag ? correlation[best_lag] / variance : 0.0f);
+    return 0.0f;
+  }
+
+  float lag = best_lag;
+  float a = correlation[best_lag - 1];
+  float b = correlation[best_lag];
+  float c = correlation[best_lag + 1];
+  float denom = a - 2 * b + c;
+  if (denom < 0.0f) {
+    lag += std::clamp(0.5f * (a - c) / denom, -0.5f, 0.5f);
+  }
+
+  return frames_per_second * 60.0f / lag;
+}
+
+int snap_to_beat(const BeatMap &beat_map, int frame_index) {
+  const auto &beats = beat_map.beats;
+  if (beats.empty()) {
+    return frame_index;
+  }
+
+  auto it = std::lower_bound(beats.begin(), beats.end(), frame_index);
+  if (it == beats.end()) {
+    return beats.back();
+  }
+  if (it != beats.begin() && frame_index - *(it - 1) < *it - frame_index) {
+    return *(it - 1);
+  }
+  return *it;
+}
+
+std::optional<int> beat_at_or_after(const BeatMap &beat_map, int frame_index) {
+  const auto &beats = beat_map.beats;
+  auto it = std::lower_bound(beats.begin(), beats.end(), frame_index);
+  if (it == beats.end()) {
+    return std::nullopt;
+  }
+  return *it;
+}
+
+std::optional<int> beat_at_or_before(const BeatMap &beat_map, int frame_index) {
+  const auto &beats = beat_map.beats;
+  auto it = std::upper_bound(beats.begin(), beats.end(), frame_index);
+  if (it == beats.begin()) {
+    return std::nullopt;
+  }
+  return *(it - 1);
+}
+
+void BeatAnalyzer::start(const SampleStore &store) {
+  cancel();
+  busy_ = true;
+  worker_ = std::jthread([this, &store](std::stop_token stop) {
+    analyze(stop, store);
+    busy_ = false;
+  });
+}
+
+void BeatAnalyzer::cancel() {
+  if (worker_.joinable()) {
+    worker_.request_stop();
+    worker_.join();
+  }
+
+  std::lock_guard lock(mutex_);
+  result_.reset();
+}
+
+bool BeatAnalyzer::busy() const {
+  return busy_;
+}
+
+std::optional<BeatMap> BeatAnalyzer::take_result() {
+  std::lock_guard lock(mutex_);
+  return std::exchange(result_, std::nullopt);
+}
+
+void BeatAnalyzer::analyze(std::stop_token stop, const SampleStore &store) {
+  const int frame_count = store.frame_count();
+  const int num_hops = std::max(0, (frame_count - kAnalysisFFTSize) / kAnalysisHopSize + 1);
+  const float frames_per_second = (float)store.sample_rate() / kAnalysisHopSize;
+
+  kiss_fft_cfg cfg = kiss_fft_alloc(kAnalysisFFTSize, 0, nullptr, nullptr);
+  std::vector<float> samples(kAnalysisFFTSize);
+  std::vector<float> hanning(kAnalysisFFTSize);
+  std::vector<float> magnitudes(kAnalysisFFTSize / 2);
+  std::vector<kiss_fft_cpx> fft_input(kAnalysisFFTSize);
+  std::vector<kiss_fft_cpx> fft_output(kAnalysisFFTSize);
+
+  for (int i = 0; i < kAnalysisFFTSize; i++) {
+    hanning[i] = 0.5 * (1 - std::cos((2 * M_PI * i) / (kAnalysisFFTSize - 1)));
+  }
+
+  // Roughly 50ms between onsets, whatever the sample rate.
+  OnsetDetector detector(magnitudes.size(), std::max(1, (int)(frames_per_second * 0.05f)));
+  BeatMap beat_map;
+  std::vector<float> envelope;
+  envelope.reserve(num_hops);
+
+  for (int hop = 0; hop < num_hops; hop++) {
+    if (stop.stop_requested()) {
+      kiss_fft_free(cfg);
+      return;
+    }
+
+    store.read_channel(0, hop * kAnalysisHopSize, samples);
+    for (int i = 0; i < kAnalysisFFTSize; i++) {
+      fft_input[i].r = samples[i] * hanning[i];
+      fft_input[i].i = 0.0f;
+    }
+
+    kiss_fft(cfg, fft_input.data(), fft_output.data());
+
+    for (int i = 0; i < magnitudes.size(); i++) {
+      auto& out = fft_output[i];
+      magnitudes[i] = std::sqrt(out.r * out.r + out.i * out.i);
+    }
+
+    if (detector.process(magnitudes)) {
+      beat_map.onsets.push_back(hop * kAnalysisHopSize + kAnalysisFFTSize / 2);
+    }
+    envelope.push_back(detector.flux());
+  }
+
+  kiss_fft_free(cfg);
+
+  // A beat grid needs onsets to hang off; without them the tempo estimate
+  // is only fitting noise in the flux envelope.
+  const float duration = (float)frame_count / store.sample_rate();
+  if (beat_map.onsets.size() >= duration * kMinOnsetsPerSecond) {
+    beat_map.bpm = estimate_tempo(envelope, frames_per_second);
+  }
+
+  if (beat_map.bpm > 0.0f) {
+    const float period = frames_per_second * 60.0f / beat_map.bpm;
+    const int tolerance = std::max(1, (int)(period * 0.1f));
+
+    int best_phase = 0;
+    float best_score = -1.0f;
+    for (int phase = 0; phase < (int)period; phase++) {
+      float score = 0.0f;
+      for (float t = phase; t < envelope.size(); t += period) {
+        score += envelope[(int)t];
+      }
+      if (score > best_score) {
+        best_score = score;
+        best_phase = phase;
+      }
+    }
+
+    // Walk the beat grid, letting each beat settle on the strongest nearby
+    // flux so small tempo drift doesn't accumulate. The beat only moves when
+    // that peak clearly stands out, both locally and against the whole track;
+    // in silence or flat passages it stays on the grid instead of sliding to
+    // the start of the search window.
+    const float envelope_mean = std::accumulate(envelope.begin(), envelope.end(), 0.0f) / envelope.size();
+    float t = best_phase;
+    while (t < envelope.size()) {
+      int center = std::min((int)std::lround(t), (int)envelope.size() - 1);
+      int lo = std::max(0, center - tolerance);
+      int hi = std::min((int)envelope.size(), center + tolerance + 1);
+
+      int peak = center;
+      float sum = 0.0f;
+      for (int i = lo; i < hi; i++) {
+        sum += envelope[i];
+        if (envelope[i] > envelope[peak] || (envelope[i] == envelope[peak] && std::abs(i - center) < std::abs(peak - center))) {
+          peak = i;
+        }
+      }
+      float mean = sum / (hi - lo);
+
+      if (envelope[peak] > mean * kMinBeatPeakRatio && envelope[peak] > envelope_mean) {
+        beat_map.beats.push_back(peak * kAnalysisHopSize + kAnalysisFFTSize / 2);
+        t = peak + period;
+      } else {
+        beat_map.beats.push_back(center * kAnalysisHopSize + kAnalysisFFTSize / 2);
+        t += period;
+      }
+    }
+  }
+
+  spdlog::info("Beat analysis: {:.1f} BPM, {} onsets, {} beats", beat_map.bpm, beat_map.onsets.size(), beat_map.beats.size());
+
+  std::lock_guard lock(mutex_);
+  result_ = std::move(beat_map);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+#include "samplestore.h"
+
+// Spectral flux onset detector. Feed it one magnitude spectrum per analysis
+// frame; all state is sized up front so process() never allocates.
+class OnsetDetector {
+public:
+  OnsetDetector(int num_bins, int min_interval, float sensitivity = 1.5f);
+
+  bool process(std::span<const float> magnitudes);
+  void reset();
+
+  float flux() const;
+
+private:
+  static constexpr int kHistorySize = 32;
+
+  std::vector<float> previous_;
+  std::array<float, kHistorySize> history_ {};
+  float history_sum_ = 0.0f;
+  int history_index_ = 0;
+  int history_count_ = 0;
+  int frames_since_onset_ = 0;
+  int min_interval_;
+  float sensitivity_;
+  float flux_ = 0.0f;
+};
+
+struct BeatMap {
+  float bpm = 0.0f;
+  std::vector<int> onsets;
+  std::vector<int> beats;
+};
+
+// Tempo of an onset strength envelope sampled at frames_per_second, found by
+// autocorrelation over the 60-200 BPM range. Returns 0 if there is too little
+// signal to tell or the best lag correlates too weakly to be a real tempo.
+float estimate_tempo(std::span<const float> envelope, float frames_per_second);
+
+// Nearest beat to frame_index, or frame_index itself if the map has no beats.
+int snap_to_beat(const BeatMap &beat_map, int frame_index);
+
+// First beat at or after / last beat at or before frame_index, if any.
+std::optional<int> beat_at_or_after(const BeatMap &beat_map, int frame_index);
+std::optional<int> beat_at_or_before(const BeatMap &beat_map, int frame_index);
+
+// Builds a BeatMap for a whole SampleStore on a worker thread. The store must
+// stay loaded until the analyzer is cancelled or has finished.
+class BeatAnalyzer {
+public:
+  void start(const SampleStore &store);
+  void cancel();
+
+  bool busy() const;
+  std::optional<BeatMap> take_result();
+
+private:
+  void analyze(std::stop_token stop, const SampleStore &store);
+
+  std::mutex mutex_;
+  std::optional<BeatMap> result_;
+  std::atomic<bool> busy_ = false;
+  std::jthread worker_;
+};
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#include "samplestore.h"
+
+namespace {
+
+const int kBlockSize = 256;
+const float kInt16Scale = 32767.0f;
+const float kInt24Scale = 8388607.0f;
+
+inline std::int32_t unpack_int24(const std::byte* p) {
+  std::uint32_t v = (std::uint32_t)p[0] | ((std::uint32_t)p[1] << 8) | ((std::uint32_t)p[2] << 16);
+  return (std::int32_t)(v << 8) >> 8;
+}
+
+inline void pack_int24(std::byte* p, std::int32_t v) {
+  p[0] = (std::byte)(v & 0xff);
+  p[1] = (std::byte)((v >> 8) & 0xff);
+  p[2] = (std::byte)((v >> 16) & 0xff);
+}
+
+void decode_block(SamplePrecision precision, const std::byte* src, float* dst, int count) {
+  switch (precision) {
+    case SamplePrecision::Float32:
+      std::memcpy(dst, src, count * sizeof(float));
+      break;
+    case SamplePrecision::Int16: {
+      std::array<std::int16_t, kBlockSize> block;
+      std::memcpy(block.data(), src, count * sizeof(std::int16_t));
+      for (int i = 0; i < count; i++) {
+        dst[i] = block[i] * (1.0f / kInt16Scale);
+      }
+      break;
+    }
+    case SamplePrecision::Int24: {
+      std::array<std::int32_t, kBlockSize> block;
+      for (int i = 0; i < count; i++) {
+        block[i] = unpack_int24(src + i * 3);
+      }
+      for (int i = 0; i < count; i++) {
+        dst[i] = block[i] * (1.0f / kInt24Scale);
+      }
+      break;
+    }
+  }
+}
+
+}
+
+void SampleStore::load(const float* interleaved, int frame_count, int channels, int sample_rate, SamplePrecision precision) {
+  frame_count_ = frame_count;
+  channels_ = channels;
+  sample_rate_ = sample_rate;
+  precision_ = precision;
+
+  const std::size_t bps = bytes_per_sample();
+  data_.assign((std::size_t)frame_count * channels * bps, std::byte{0});
+  data_.shrink_to_fit();
+
+  std::array<float, kBlockSize> block;
+  for (int c = 0; c < channels; c++) {
+    std::byte* dst = data_.data() + (std::size_t)c * frame_count * bps;
+
+    for (int start = 0; start < frame_count; start += kBlockSize) {
+      int count = std::min(kBlockSize, frame_count - start);
+      const float* src = &interleaved[(std::size_t)start * channels + c];
+      for (int i = 0; i < count; i++) {
+        block[i] = std::clamp(src[i * channels], -1.0f, 1.0f);
+      }
+
+      std::byte* out = dst + (std::size_t)start * bps;
+      switch (precision) {
+        case SamplePrecision::Float32:
+          std::memcpy(out, block.data(), count * sizeof(float));
+          break;
+        case SamplePrecision::Int16: {
+          std::array<std::int16_t, kBlockSize> packed;
+          for (int i = 0; i < count; i++) {
+            packed[i] = (std::int16_t)std::lrint(block[i] * kInt16Scale);
+          }
+          std::memcpy(out, packed.data(), count * sizeof(std::int16_t));
+          break;
+        }
+        case SamplePrecision::Int24:
+          for (int i = 0; i < count; i++) {
+            pack_int24(out + i * 3, (std::int32_t)std::lrint(block[i] * kInt24Scale));
+          }
+          break;
+      }
+    }
+  }
+}
+
+void SampleStore::clear() {
+  data_.clear();
+  data_.shrink_to_fit();
+  frame_count_ = 0;
+  channels_ = 0;
+  sample_rate_ = 0;
+}
+
+bool SampleStore::empty() const {
+  return frame_count_ == 0;
+}
+
+int SampleStore::frame_count() const {
+  return frame_count_;
+}
+
+int SampleStore::channels() const {
+  return channels_;
+}
+
+int SampleStore::sample_rate() const {
+  return sample_rate_;
+}
+
+SamplePrecision SampleStore::precision() const {
+  return precision_;
+}
+
+std::size_t SampleStore::size_bytes() const {
+  return data_.size();
+}
+
+int SampleStore::read_channel(int channel, int start_frame, std::span<float> out) const {
+  if (channel < 0 || channel >= channels_ || start_frame < 0 || start_frame >= frame_count_) {
+    return 0;
+  }
+
+  const int frames = std::min((int)out.size(), frame_count_ - start_frame);
+  const std::size_t bps = bytes_per_sample();
+  const std::byte* src = channel_data(channel) + (std::size_t)start_frame * bps;
+
+  for (int i = 0; i < frames; i += kBlockSize) {
+    int count = std::min(kBlockSize, frames - i);
+    decode_block(precision_, src + (std::size_t)i * bps, &out[i], count);
+  }
+
+  return frames;
+}
+
+int SampleStore::read_interleaved(int start_frame, std::span<float> out) const {
+  if (channels_ == 0 || start_frame < 0 || start_frame >= frame_count_) {
+    return 0;
+  }
+
+  const int frames = std::min((int)out.size() / channels_, frame_count_ - start_frame);
+  std::array<float, kBlockSize> block;
+
+  for (int i = 0; i < frames; i += kBlockSize) {
+    int count = std::min(kBlockSize, frames - i);
+    for (int c = 0; c < channels_; c++) {
+      read_channel(c, start_frame + i, std::span<float>(block.data(), count));
+      float* dst = &out[(std::size_t)i * channels_ + c];
+      for (int j = 0; j < count; j++) {
+        dst[j * channels_] = block[j];
+      }
+    }
+  }
+
+  return frames;
+}
+
+std::pair<float, float> SampleStore::peaks(int start_frame, int end_frame) const {
+  start_frame = std::clamp(start_frame, 0, frame_count_);
+  end_frame = std::clamp(end_frame, start_frame, frame_count_);
+
+  float min_sample = 0.0f;
+  float max_sample = 0.0f;
+  if (start_frame == end_frame) {
+    return { min_sample, max_sample };
+  }
+
+  std::array<float, kBlockSize> block;
+  for (int c = 0; c < channels_; c++) {
+    for (int i = start_frame; i < end_frame; i += kBlockSize) {
+      int count = std::min(kBlockSize, end_frame - i);
+      read_channel(c, i, std::span<float>(block.data(), count));
+      const auto [min, max] = std::minmax_element(block.begin(), block.begin() + count);
+      min_sample = std::min(min_sample, *min);
+      max_sample = std::max(max_sample, *max);
+    }
+  }
+
+  return { min_sample, max_sample };
+}
+
+std::size_t SampleStore::bytes_per_sample() const {
+  switch (precision_) {
+    case SamplePrecision::Int16:
+      return 2;
+    case SamplePrecision::Int24:
+      return 3;
+    case SamplePrecision::Float32:
+    default:
+      return 4;
+  }
+}
+
+const std::byte* SampleStore::channel_data(int channel) const {
+  return data_.data() + (std::size_t)channel * frame_count_ * bytes_per_sample();
+}
+
+void PeakCache::build(const SampleStore &store, int frames_per_peak) {
+  const int num_peaks = (store.frame_count() + frames_per_peak - 1) / frames_per_peak;
+
+  frames_per_peak_ = frames_per_peak;
+  frame_count_ = store.frame_count();
+  min_.resize(num_peaks);
+  max_.resize(num_peaks);
+
+  for (int i = 0; i < num_peaks; i++) {
+    const auto [min, max] = store.peaks(i * frames_per_peak, (i + 1) * frames_per_peak);
+    min_[i] = min;
+    max_[i] = max;
+  }
+}
+
+void PeakCache::clear() {
+  frames_per_peak_ = 0;
+  frame_count_ = 0;
+  min_.clear();
+  max_.clear();
+}
+
+bool PeakCache::empty() const {
+  return min_.empty();
+}
+
+std::pair<float, float> PeakCache::peaks(int start_frame, int end_frame) const {
+  start_frame = std::max(start_frame, 0);
+  end_frame = std::min(end_frame, frame_count_);
+  if (empty() || end_frame <= start_frame) {
+    return { 0.0f, 0.0f };
+  }
+
+  const int num_peaks = min_.size();
+  const int first = std::clamp(start_frame / frames_per_peak_, 0, num_peaks - 1);
+  const int last = std::clamp((end_frame + frames_per_peak_ - 1) / frames_per_peak_, first + 1, num_peaks);
+
+  return {
+    *std::min_element(min_.begin() + first, min_.begin() + last),
+    *std::max_element(max_.begin() + first, max_.begin() + last),
+  };
+}
+
+SamplePrecision precision_for_sample_size(int sample_size) {
+  switch (sample_size) {
+    case 8:
+    case 16:
+      return SamplePrecision::Int16;
+    case 24:
+      return SamplePrecision::Int24;
+    default:
+      return SamplePrecision::Float32;
+  }
+}
+
+const char* precision_name(SamplePrecision precision) {
+  switch (precision) {
+    case SamplePrecision::Int16:
+      return "int16";
+    case SamplePrecision::Int24:
+      return "int24";
+    case SamplePrecision::Float32:
+    default:
+      return "float32";
+  }
+}
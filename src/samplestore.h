@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+enum class SamplePrecision {
+  Float32,
+  Int16,
+  Int24,
+};
+
+// Decoded audio kept in planar (per-channel contiguous) layout at a chosen
+// storage precision. Reads always come out as float and are converted in
+// fixed-size blocks so the loops stay vectorizable.
+class SampleStore {
+public:
+  void load(const float* interleaved, int frame_count, int channels, int sample_rate, SamplePrecision precision);
+  void clear();
+
+  bool empty() const;
+  int frame_count() const;
+  int channels() const;
+  int sample_rate() const;
+  SamplePrecision precision() const;
+  std::size_t size_bytes() const;
+
+  // Copies frames [start_frame, start_frame + out.size()) of one channel into
+  // out. Frames past the end are not written; returns the number copied.
+  int read_channel(int channel, int start_frame, std::span<float> out) const;
+
+  // Same as read_channel but interleaves all channels, as the audio stream
+  // expects. out.size() must be a multiple of channels().
+  int read_interleaved(int start_frame, std::span<float> out) const;
+
+  // Minimum and maximum sample over all channels for [start_frame, end_frame).
+  std::pair<float, float> peaks(int start_frame, int end_frame) const;
+
+private:
+  std::size_t bytes_per_sample() const;
+  const std::byte* channel_data(int channel) const;
+
+  std::vector<std::byte> data_;
+  int frame_count_ = 0;
+  int channels_ = 0;
+  int sample_rate_ = 0;
+  SamplePrecision precision_ = SamplePrecision::Float32;
+};
+
+// Min/max over all channels of a SampleStore in fixed-size frame blocks, so
+// overviews can be redrawn at any width without rescanning the samples.
+class PeakCache {
+public:
+  void build(const SampleStore &store, int frames_per_peak);
+  void clear();
+
+  bool empty() const;
+
+  // Same as SampleStore::peaks, rounded out to whole blocks.
+  std::pair<float, float> peaks(int start_frame, int end_frame) const;
+
+private:
+  int frames_per_peak_ = 0;
+  int frame_count_ = 0;
+  std::vector<float> min_;
+  std::vector<float> max_;
+};
+
+SamplePrecision precision_for_sample_size(int sample_size);
+const char* precision_name(SamplePrecision precision);